@@ -6,6 +6,10 @@
 #include "grain.h"
 #include "bitmaps.h"
 #include "gateInEnhanced.h"
+#include "transients.h"
+#include "midiScheduler.h"
+#include "deadlineWatchdog.h"
+#include "grainPrefetcher.h"
 
 using namespace daisy;
 using namespace patch_sm;
@@ -17,6 +21,7 @@ const int RECORDING_BUFFER_SIZE = 48000 * 5; // X seconds at 48kHz
 const int MIN_GRAIN_SIZE = 480; // 10 ms
 const int MAX_GRAIN_SIZE = 48000 * 2; // 2 second
 const int MAX_GRAIN_COUNT = 32;
+const size_t PREFETCH_WINDOW_SIZE = 256; // Samples per grain per block. Grains reading more than this read from SDRAM
 const bool SHOW_PERFORMANCE_BARS = true;
 const uint8_t MAX_SPAWN_POINTS_POT = 5;
 const uint8_t MAX_SPAWN_POINTS_CV = 5;
@@ -24,9 +29,42 @@ const uint8_t MAX_SPAWN_POINTS = MAX_SPAWN_POINTS_POT + MAX_SPAWN_POINTS_CV + 2;
 const int SPAWN_BAR_FLASH_MILLIS = 250;
 const int SPAWN_LED_FLASH_MILLIS = 250;
 const int SPAWN_TRIGGER_OUT_MILLIS = 2;
+const int SPAWN_MODE_HOLD_MILLIS = 1000; // How long to hold the spawn button to change spawn mode
+const size_t MAX_TRANSIENTS = 128;
+const int STRETCH_OVERLAP = 4; // Grains playing at once in stretch mode. Must be even
+const int STRETCH_RESERVED_GRAINS = STRETCH_OVERLAP + 1; // Kept free for stretch mode's hop grains
+const size_t MAX_SCHEDULED_NOTES = 32;
+const uint8_t MIDI_ROOT_NOTE = 60; // Plays at the pitch knob's pitch
+const bool USE_MOCK_MIDI = false; // Replace MIDI in with a test arpeggio
+const uint32_t MOCK_MIDI_INTERVAL_MILLIS = 150;
+const bool RUN_BENCHMARKS = false; // Render the benchmark scenarios and log the results on startup
+const size_t BENCHMARK_SAMPLES = 48000; // Rendered per scenario
+const size_t BENCHMARK_BLOCK_SIZE = 48; // Only the rendering of each block is timed
+const size_t FAST_MATH_BENCHMARK_SAMPLES = 100000; // Spread evenly over each function's range
+const int DEGRADED_MAX_GRAIN_COUNT = MAX_GRAIN_COUNT / 2;
+const uint32_t OLED_UPDATE_MILLIS = 8;
+const uint32_t DEGRADED_OLED_UPDATE_MILLIS = 33;
+
+// What gets sacrificed, in order, when the audio callback can't keep up
+enum class Degradation {
+    NONE,
+    NEAREST_SAMPLE, // Skip interpolating between samples
+    NO_REVERB,
+    CAPPED_GRAINS, // Limit grains to DEGRADED_MAX_GRAIN_COUNT
+    SLOW_DISPLAY, // Redraw the OLED less often
+    COUNT
+};
+
+enum class SpawnMode {
+    FREE,
+    SNAP_TO_TRANSIENTS, // Spawn positions move back to the start of the note they land in
+    STRETCH, // Evenly overlapping grains from the first spawn position, scan speed sets the stretch
+    COUNT
+};
 
 DaisyPatchSM patch;
 CpuLoadMeter cpu_load_meter;
+DeadlineWatchdog deadline_watchdog;
 
 Switch       density_length_link_switch;
 Switch       spawn_button;
@@ -36,6 +74,10 @@ GateInEnhanced spawn_gate;
 
 ReverbSc     reverb;
 
+MidiUartReceiver<MAX_SCHEDULED_NOTES> midi; // TRS MIDI in
+MockMidiStream mock_midi;
+MidiScheduler<MAX_SCHEDULED_NOTES> midi_scheduler;
+
 uint8_t DMA_BUFFER_MEM_SECTION oled_buffer[SSD1327_REQUIRED_DMA_BUFFER_SIZE];
 Daisy_SSD1327 oled;
 SpiHandle spi;
@@ -44,6 +86,9 @@ float DSY_SDRAM_BSS recording[RECORDING_BUFFER_SIZE];
 size_t recording_length = RECORDING_BUFFER_SIZE;
 size_t write_head = 0;
 
+OnsetDetector onset_detector;
+TransientIndex<MAX_TRANSIENTS> transient_index;
+
 const size_t RENDERABLE_RECORDING_BUFFER_SIZE = oled.width;
 const float RECORDING_TO_RENDERABLE_RECORDING_BUFFER_RATIO = RENDERABLE_RECORDING_BUFFER_SIZE / (float)RECORDING_BUFFER_SIZE;
 const float RENDERABLE_RECORDING_TO_RECORDING_BUFFER_RATIO = RECORDING_BUFFER_SIZE / (float)RENDERABLE_RECORDING_BUFFER_SIZE;
@@ -60,13 +105,17 @@ float spawn_positions_splay;
 float spawn_positions_count;
 float pitch_shift_in_octaves;
 bool primed_for_manual_spawn = true;
+SpawnMode spawn_mode = SpawnMode::FREE;
+bool has_changed_spawn_mode = false;
 int grain_length;
 float grain_density; // Target concurrent grains
 unsigned int spawn_time; // The number of samples between each new grain
 float actual_spawn_time;
+int stretch_hop; // The number of samples between each new grain in stretch mode
 float spawn_time_spread; // The variance of the spawn rate
 uint32_t last_spawn_time;
 float reverb_wet_mix;
+bool is_reverb_bypassed = false; // Skips the reverb entirely, for benchmarking without it
 
 int next_spawn_position_index = 0;
 float spawn_position = 0.f;
@@ -74,11 +123,15 @@ float next_spawn_offset;
 uint32_t samples_since_last_non_manual_spawn = 0;
 
 Grain grains[MAX_GRAIN_COUNT];
+GrainPrefetcher<MAX_GRAIN_COUNT, PREFETCH_WINDOW_SIZE> grain_prefetcher;
 Stack<uint8_t, MAX_GRAIN_COUNT> available_grains;
 
 uint32_t last_oled_update_millis = 0;
 uint32_t last_debug_print_millis = 0;
 uint32_t last_led_update_millis = 0;
+uint32_t last_logged_overrun_count = 0;
+int last_logged_degradation_level = 0;
+uint32_t last_logged_failed_prefetch_count = 0;
 
 void AudioCallback(
     AudioHandle::InputBuffer  in,
@@ -86,6 +139,10 @@ void AudioCallback(
     size_t size
 );
 
+inline bool is_degraded(Degradation degradation) {
+    return deadline_watchdog.GetLevel() >= (int)degradation;
+}
+
 void lightenPixel(iVec2 coords, uint8_t color) {
     oled.lightenPixel(coords.x, coords.y, color);
 }
@@ -105,7 +162,14 @@ inline size_t get_spawn_position(int index) {
         unwrapped_spawn_position += index * (spawn_positions_splay / (spawn_positions_count - 2));
     }
     
-    return fwrap(unwrapped_spawn_position, 0.f, recording_length);
+    size_t wrapped_spawn_position = fwrap(unwrapped_spawn_position, 0.f, recording_length);
+
+    size_t transient_position;
+    if (spawn_mode == SpawnMode::SNAP_TO_TRANSIENTS && transient_index.FindAtOrBefore(wrapped_spawn_position, transient_position)) {
+        return transient_position;
+    }
+
+    return wrapped_spawn_position;
 }
 
 float renderable_recording_at_deg(float deg) {
@@ -174,6 +238,16 @@ void draw_grain_spawn_positions() {
     }
 }
 
+void draw_transients() {
+    for (size_t i = 0; i < transient_index.GetCount(); i++) {
+        float transient_deg = transient_index.Get(i) / (float)RECORDING_BUFFER_SIZE * 360;
+
+        for (int r = 36; r < 40; r++) {
+            lightenPixel(polarToCartesian(r, transient_deg), 6);
+        }
+    }
+}
+
 float pitch_to_radius(float pitch_shift_in_octaves) {
     return 40 + fwrap(pitch_shift_in_octaves, -0.5f, 0.5f) * 42;
 }
@@ -210,8 +284,9 @@ void draw_grains() {
             float deg = (sample_offset / (float)recording_length) * 360;
             uint8_t r = pitch_to_radius(grain.pitch_shift_in_octaves);
 
-            uint8_t tail_length = 3 + powf((grain.pitch_shift_in_octaves + 7) / 14, 2.5f) * 20;
-            float amplitude = 2 * envelope(min((grain.length - grain.step), grain.step) / (float)grain.length);  
+            uint8_t tail_length = 3 + fast_pow((grain.pitch_shift_in_octaves + 7) / 14, 2.5f) * 20;
+            float envelope_progress = min((grain.length - grain.step), grain.step) / (float)grain.length;
+            float amplitude = grain.has_overlap_add_window ? envelope(envelope_progress * 2) : 2 * envelope(envelope_progress);
 
             for (int j = 0; j < tail_length; j++) {
                 lightenPixel(
@@ -263,11 +338,26 @@ void draw_performance_bars() {
             oled.lightenPixel(x, 6, 0);
         }
     }
+
+    // Degradation level
+    uint8_t degradation_x = deadline_watchdog.GetLevel() / (float)deadline_watchdog.GetMaxLevel() * oled.width;
+    for (int x = 0; x < oled.width; x++) {
+        if (x < degradation_x) {
+            oled.lightenPixel(x, 7, 10);
+            oled.lightenPixel(x, 8, 10);
+        } else {
+            oled.lightenPixel(x, 7, 0);
+            oled.lightenPixel(x, 8, 0);
+        }
+    }
 }
 
-// Responsible for wrapping the index
-inline float get_sample(int index) {
-    return recording[wrap(index, 0, recording_length)];
+// Reads from the grain's prefetched window when it can, otherwise straight from the recording
+inline float get_grain_sample(int grain_index, int index) {
+    size_t wrapped_index = wrap(index, 0, recording_length);
+    const float *prefetched_sample = grain_prefetcher.Find(grain_index, wrapped_index);
+
+    return prefetched_sample ? *prefetched_sample : recording[wrapped_index];
 }
 
 inline void record_xfaded_sample(float sample_in) {
@@ -343,7 +433,7 @@ void process_controls() {
 
     // Length
     float grain_length_control = coerce_in_range(raw_length_cv + raw_length_pot * 2 - 1, -1, 1);
-    grain_length = map_to_range(pow(abs(grain_length_control), 2), MIN_GRAIN_SIZE, MAX_GRAIN_SIZE);
+    grain_length = map_to_range(grain_length_control * grain_length_control, MIN_GRAIN_SIZE, MAX_GRAIN_SIZE);
     if (grain_length_control < 0) {
         grain_length = -grain_length;
     }
@@ -351,12 +441,15 @@ void process_controls() {
     // Density
     float density_control = coerce_in_range(raw_density_pot + raw_density_cv, 0, 1);
     if (density_length_link_switch.Pressed()) {
-        spawn_time = map_to_range(1 - log10f(1 + density_control * 9), 0, MAX_GRAIN_SIZE / 4);
+        spawn_time = map_to_range(1 - fast_log10(1 + density_control * 9), 0, MAX_GRAIN_SIZE / 4);
     } else {
-        grain_density = map_to_range(pow(density_control, 2), 0.5f, MAX_GRAIN_COUNT);
+        grain_density = map_to_range(density_control * density_control, 0.5f, MAX_GRAIN_COUNT);
         spawn_time = abs(grain_length) / grain_density;
     }
 
+    // Stretch mode keeps STRETCH_OVERLAP grains playing at all times
+    stretch_hop = max(1, abs(grain_length) / STRETCH_OVERLAP);
+
     // Jitter
     spawn_time_spread = raw_jitter_pot;
     if (density_control <= 0.001) {
@@ -368,7 +461,7 @@ void process_controls() {
     // Reverb
     float reverb_amount = max(0.f, raw_reverb_pot + raw_reverb_cv);
     float reverb_time = fmap(min(reverb_amount, 0.5f) * 2, 0.5f, 0.99f);
-    float reverb_damp = fmap(reverb_amount, 100.f, 24000.f, Mapping::LOG);
+    float reverb_damp = fast_fmap_log(reverb_amount, 100.f, 24000.f);
     reverb_wet_mix = min(reverb_amount, 0.1f) * 7;
 
     reverb.SetFeedback(reverb_time);
@@ -382,6 +475,9 @@ void process_controls() {
         if (!is_recording) {
             is_recording = true;
             recording_xfade_step = 0;
+
+            // The write head kept moving while paused, so start the index's ordering from where it is now
+            transient_index.Reanchor(write_head);
         } else {
             is_stopping_recording = true;
         }
@@ -392,37 +488,86 @@ void process_controls() {
         primed_for_manual_spawn = true;
     }
 
+    // Holding the spawn button cycles through the spawn modes
+    if (spawn_button.TimeHeldMs() >= SPAWN_MODE_HOLD_MILLIS && !has_changed_spawn_mode) {
+        spawn_mode = (SpawnMode)(((int)spawn_mode + 1) % (int)SpawnMode::COUNT);
+        has_changed_spawn_mode = true;
+    } else if (spawn_button.FallingEdge()) {
+        has_changed_spawn_mode = false;
+    }
+
     // Spawn trigger out
     int time_since_last_spawn = System::GetNow() - last_spawn_time;
     dsy_gpio_write(&patch.gate_out_2, time_since_last_spawn < SPAWN_TRIGGER_OUT_MILLIS);
 }
 
-void spawn_grain() {
+int count_stretch_grains() {
+    int count = 0;
+    for (int j = 0; j < MAX_GRAIN_COUNT; j++) {
+        if (is_alive(grains[j]) && grains[j].has_overlap_add_window) count++;
+    }
+    return count;
+}
+
+// In stretch mode, anything other than a hop grain has to leave room for the
+// hop grains, or they'd spawn late and the overlap-add level would dip
+inline bool can_spawn_grain(bool is_stretch_grain) {
+    int max_grain_count = is_degraded(Degradation::CAPPED_GRAINS) ? DEGRADED_MAX_GRAIN_COUNT : MAX_GRAIN_COUNT;
+    int alive_count = MAX_GRAIN_COUNT - (int)available_grains.GetNumElements();
+
+    if (spawn_mode != SpawnMode::STRETCH || is_stretch_grain) {
+        return alive_count < max_grain_count;
+    }
+
+    return alive_count - count_stretch_grains() < max_grain_count - STRETCH_RESERVED_GRAINS;
+}
+
+// Stretch grains are the ones on stretch mode's fixed hop. Anything else (manual
+// spawns, MIDI) spawns a normal grain on top, so it can't upset their constant level.
+void spawn_grain(float grain_pitch_shift_in_octaves, float grain_amplitude, bool is_stretch_grain) {
     size_t new_grain_index = available_grains.PopBack();
 
-    grains[new_grain_index].length = abs(grain_length);
+    int spawn_position_index = is_stretch_grain ? 0 : next_spawn_position_index;
+
     grains[new_grain_index].step = 0;
     grains[new_grain_index].pan = 0.5f;// + randF(-0.5f, 0.5f);
     
-    grains[new_grain_index].spawn_position_index = next_spawn_position_index;
-    grains[new_grain_index].spawn_position = get_spawn_position(next_spawn_position_index);
+    grains[new_grain_index].spawn_position_index = spawn_position_index;
+    grains[new_grain_index].spawn_position = get_spawn_position(spawn_position_index);
 
     grains[new_grain_index].spawn_time_millis = System::GetNow();
     last_spawn_time = grains[new_grain_index].spawn_time_millis;
 
-    grains[new_grain_index].pitch_shift_in_octaves = pitch_shift_in_octaves;
+    grains[new_grain_index].pitch_shift_in_octaves = grain_pitch_shift_in_octaves;
+
+    if (is_stretch_grain) {
+        // Lengths are an exact multiple of the hop so the overlapping windows always add up to the same level
+        grains[new_grain_index].length = stretch_hop * STRETCH_OVERLAP;
+        grains[new_grain_index].has_overlap_add_window = true;
+        grains[new_grain_index].amplitude = grain_amplitude * 2.f / STRETCH_OVERLAP;
+    } else {
+        grains[new_grain_index].length = abs(grain_length);
+        grains[new_grain_index].has_overlap_add_window = false;
+        grains[new_grain_index].amplitude = grain_amplitude;
+    }
 
     // Reverse the playback if the length is negative
     if (grain_length > 0) {
-        grains[new_grain_index].playback_speed = pow(2, pitch_shift_in_octaves);
+        grains[new_grain_index].playback_speed = fast_exp2(grain_pitch_shift_in_octaves);
     } else {
-        grains[new_grain_index].playback_speed = -pow(2, pitch_shift_in_octaves);
+        grains[new_grain_index].playback_speed = -fast_exp2(grain_pitch_shift_in_octaves);
     }
 
     next_spawn_offset = randF(-1.f, 1.f); // +/- 100%
     next_spawn_position_index = wrap(next_spawn_position_index + 1, 0, (int)spawn_positions_count);
 }
 
+void spawn_midi_grain(ScheduledNote note) {
+    float note_pitch_shift_in_octaves = pitch_shift_in_octaves + (note.note - MIDI_ROOT_NOTE) / 12.f;
+
+    spawn_grain(note_pitch_shift_in_octaves, note.velocity / 127.f, false);
+}
+
 void record_sample(float sample) {
     if (is_stopping_recording) {
         // Record a little extra at the end of the recording so we can xfade the values
@@ -463,6 +608,15 @@ void record_sample_for_display(float sample) {
     }
 }
 
+void record_transients(float sample) {
+    // Forget transients as the audio they point to gets overwritten
+    transient_index.Evict(write_head);
+
+    if (onset_detector.Process(sample)) {
+        transient_index.Insert(write_head);
+    }
+}
+
 void increment_write_head() {
     write_head++;
 
@@ -475,19 +629,32 @@ void calculate_audio_out(float in_l, float in_r, float &out_l, float &out_r) {
     float wet_l = 0.f;
     float wet_r = 0.f;
 
+    // Checked once up front rather than per grain, the level only changes between blocks
+    bool is_nearest_sample = is_degraded(Degradation::NEAREST_SAMPLE);
+    bool should_process_reverb = !is_reverb_bypassed && !is_degraded(Degradation::NO_REVERB);
+
     for (int j = 0; j < MAX_GRAIN_COUNT; j++) {
         if (is_alive(grains[j])) {
             size_t buffer_index = grains[j].spawn_position + grains[j].step * grains[j].playback_speed;
 
             // playback_speed is a float so we need to interpolate between samples
-            float sample = get_sample(buffer_index);
-            float next_sample = get_sample(buffer_index + 1);
+            float sample = get_grain_sample(j, buffer_index);
+            float interpolated_sample;
 
-            float decimal_portion = modf(grains[j].step * grains[j].playback_speed);
-            float interpolated_sample = sample * (1 - decimal_portion) + next_sample * decimal_portion;
+            if (is_nearest_sample) {
+                interpolated_sample = sample;
+            } else {
+                float next_sample = get_grain_sample(j, buffer_index + 1);
+
+                float decimal_portion = modf(grains[j].step * grains[j].playback_speed);
+                interpolated_sample = sample * (1 - decimal_portion) + next_sample * decimal_portion;
+            }
 
             float envelope_progress = min((grains[j].length - grains[j].step), grains[j].step) / max(1.f, (float)grains[j].length);
-            float signal = interpolated_sample * envelope(envelope_progress);
+            if (grains[j].has_overlap_add_window) {
+                envelope_progress *= 2;
+            }
+            float signal = interpolated_sample * envelope(envelope_progress) * grains[j].amplitude;
 
             wet_l += (1.f - grains[j].pan) * signal;
             wet_r += grains[j].pan * signal;
@@ -502,16 +669,504 @@ void calculate_audio_out(float in_l, float in_r, float &out_l, float &out_r) {
 
     float reverb_in_l = wet_l;
     float reverb_in_r = wet_r;
-    float reverb_wet_l, reverb_wet_r;
-    reverb.Process(reverb_in_l, reverb_in_r, &reverb_wet_l, &reverb_wet_r);
+    float reverb_wet_l = 0.f;
+    float reverb_wet_r = 0.f;
+    if (should_process_reverb) {
+        reverb.Process(reverb_in_l, reverb_in_r, &reverb_wet_l, &reverb_wet_r);
+    }
     
     out_l = reverb_in_l + (reverb_wet_l * reverb_wet_mix) + in_l;
     out_r = reverb_in_r + (reverb_wet_r * reverb_wet_mix) + in_r;
 }
 
+// Starts copying the part of the recording each grain will read next block into fast memory
+void prefetch_grain_windows(size_t size) {
+    // Everything recorded next block, plus the sample after for interpolation
+    size_t write_span = size + 1;
+
+    grain_prefetcher.BeginPlan();
+
+    for (int j = 0; j < MAX_GRAIN_COUNT; j++) {
+        if (!is_alive(grains[j])) continue;
+
+        float first_offset = grains[j].step * grains[j].playback_speed;
+        float last_offset = (grains[j].step + size - 1) * grains[j].playback_speed;
+
+        // Pad either end to cover rounding and interpolation
+        int start = floorf(grains[j].spawn_position + min(first_offset, last_offset)) - 1;
+        int end = ceilf(grains[j].spawn_position + max(first_offset, last_offset)) + 2;
+
+        // Windows don't wrap around the end of the recording
+        if (start < 0 || end > (int)recording_length) continue;
+
+        // Don't copy anything that'll be overwritten before it's read
+        size_t window_length = end - start;
+        size_t distance_from_write_head = (start - write_head + recording_length) % recording_length;
+        size_t distance_to_write_head = (write_head - start + recording_length) % recording_length;
+        if (distance_from_write_head < write_span || distance_to_write_head < window_length) continue;
+
+        grain_prefetcher.Plan(j, recording, start, window_length);
+    }
+
+    grain_prefetcher.StartTransfer();
+}
+
+struct BenchmarkScenario {
+    const char *name;
+    int grain_count; // Kept topped up for the whole scenario
+    float pitch_range_in_octaves; // Grains are pitched evenly across +/- this
+    bool reverse;
+    bool reverb;
+    int grain_length;
+    float jitter; // How much grain lengths vary
+};
+
+// Scenarios with more grains than MAX_GRAIN_COUNT are skipped
+const BenchmarkScenario BENCHMARK_SCENARIOS[] = {
+    // Name               Grains            Pitch  Reverse  Reverb  Length          Jitter
+    { "1 grain",          1,                0.f,   false,   false,  4800,           0.f },
+    { "4 grains",         4,                0.f,   false,   false,  4800,           0.f },
+    { "16 grains",        16,               0.f,   false,   false,  4800,           0.f },
+    { "max grains",       MAX_GRAIN_COUNT,  0.f,   false,   false,  4800,           0.f },
+    { "narrow pitch",     MAX_GRAIN_COUNT,  0.5f,  false,   false,  4800,           0.f },
+    { "wide pitch",       MAX_GRAIN_COUNT,  2.f,   false,   false,  4800,           0.f },
+    { "reverse",          MAX_GRAIN_COUNT,  0.5f,  true,    false,  4800,           0.f },
+    { "reverb",           MAX_GRAIN_COUNT,  0.f,   false,   true,   4800,           0.f },
+    { "short grains",     MAX_GRAIN_COUNT,  0.f,   false,   false,  MIN_GRAIN_SIZE, 0.f },
+    { "long grains",      MAX_GRAIN_COUNT,  0.f,   false,   false,  MAX_GRAIN_SIZE, 0.f },
+    { "jitter",           MAX_GRAIN_COUNT,  0.f,   false,   false,  4800,           1.f },
+    { "everything",       MAX_GRAIN_COUNT,  2.f,   true,    true,   4800,           1.f },
+};
+const size_t BENCHMARK_SCENARIO_COUNT = sizeof(BENCHMARK_SCENARIOS) / sizeof(BENCHMARK_SCENARIOS[0]);
+
+// Checksums of each scenario's rendered output, in the same order. 0 if it hasn't been recorded yet.
+// Whenever any are missing or changed, the benchmark log ends with a replacement for this table.
+const uint32_t BENCHMARK_GOLDEN_CHECKSUMS[BENCHMARK_SCENARIO_COUNT] = {};
+
+// FNV-1a over the bits of the sample, so any numerical change shows up
+inline uint32_t hash_sample(uint32_t hash, float sample) {
+    uint32_t bits;
+    memcpy(&bits, &sample, sizeof(bits));
+
+    for (int i = 0; i < 4; i++) {
+        hash ^= (bits >> (i * 8)) & 0xFF;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+void reset_grains() {
+    for (int i = 0; i < MAX_GRAIN_COUNT; i++) {
+        grains[i] = Grain();
+        grains[i].step = grains[i].length + 1; // Dead
+    }
+
+    available_grains.Clear();
+    for (u_int8_t i = 0; i < MAX_GRAIN_COUNT; i++) {
+        available_grains.PushBack(i);
+    }
+}
+
+// Returns the index of the new grain
+size_t spawn_benchmark_grain(const BenchmarkScenario &scenario, int spawn_count) {
+    size_t new_grain_index = available_grains.PopBack();
+    Grain &grain = grains[new_grain_index];
+
+    float pitch_fraction = scenario.grain_count > 1 ? (spawn_count % scenario.grain_count) / (float)(scenario.grain_count - 1) : 0.5f;
+
+    grain.length = scenario.grain_length * (1 + randF(-0.5f, 0.5f) * scenario.jitter);
+    grain.step = 0;
+    grain.pan = 0.5f;
+    grain.spawn_position = randF(0, RECORDING_BUFFER_SIZE);
+    grain.pitch_shift_in_octaves = map_to_range(pitch_fraction, -scenario.pitch_range_in_octaves, scenario.pitch_range_in_octaves);
+    grain.amplitude = 1.f;
+    grain.has_overlap_add_window = false;
+    grain.playback_speed = fast_exp2(grain.pitch_shift_in_octaves) * (scenario.reverse ? -1 : 1);
+
+    return new_grain_index;
+}
+
+struct FastMathBenchmark {
+    const char *name;
+    float (*fast)(float);
+    float (*reference)(float); // From libm
+    float min; // Range to check over
+    float max;
+    float max_error; // As documented in utils.h
+    bool is_relative_error;
+};
+
+const FastMathBenchmark FAST_MATH_BENCHMARKS[] = {
+    { "exp2", fast_exp2, exp2f, -126.f, 127.f, FAST_EXP2_MAX_RELATIVE_ERROR, true },
+    { "log2", fast_log2, log2f, 0.001f, 1000.f, FAST_LOG2_MAX_ERROR, false },
+    { "log10", fast_log10, log10f, 0.001f, 1000.f, FAST_LOG10_MAX_ERROR, false },
+    { "sin", fast_sin, sinf, -100.f, 100.f, FAST_SIN_COS_MAX_ERROR, false },
+    { "cos", fast_cos, cosf, -100.f, 100.f, FAST_SIN_COS_MAX_ERROR, false },
+    {
+        "pow 2.5",
+        [](float x) { return fast_pow(x, 2.5f); },
+        [](float x) { return powf(x, 2.5f); },
+        0.001f, 4.f, FAST_POW_MAX_RELATIVE_ERROR, true
+    },
+    {
+        "log fmap",
+        [](float x) { return fast_fmap_log(x, 100.f, 24000.f); },
+        [](float x) { return fmap(x, 100.f, 24000.f, Mapping::LOG); },
+        0.f, 1.f, FAST_FMAP_LOG_MAX_RELATIVE_ERROR, true
+    },
+};
+const size_t FAST_MATH_BENCHMARK_COUNT = sizeof(FAST_MATH_BENCHMARKS) / sizeof(FAST_MATH_BENCHMARKS[0]);
+
+// Times a function over the benchmark's range. Returns the sum of the results so it can't be optimised away
+float time_fast_math_function(const FastMathBenchmark &benchmark, float (*function)(float), uint32_t &cycles) {
+    float step = (benchmark.max - benchmark.min) / FAST_MATH_BENCHMARK_SAMPLES;
+    float sum = 0.f;
+
+    uint32_t start_cycles = DWT->CYCCNT;
+    for (size_t i = 0; i < FAST_MATH_BENCHMARK_SAMPLES; i++) {
+        sum += function(benchmark.min + i * step);
+    }
+    cycles = DWT->CYCCNT - start_cycles;
+
+    return sum;
+}
+
+// Checks the fast math functions stay within their documented error and logs how they compare to libm
+void run_fast_math_benchmarks(float ns_per_cycle) {
+    int failed_count = 0;
+
+    for (size_t b = 0; b < FAST_MATH_BENCHMARK_COUNT; b++) {
+        const FastMathBenchmark &benchmark = FAST_MATH_BENCHMARKS[b];
+        float step = (benchmark.max - benchmark.min) / FAST_MATH_BENCHMARK_SAMPLES;
+        float worst_error = 0.f;
+
+        for (size_t i = 0; i <= FAST_MATH_BENCHMARK_SAMPLES; i++) {
+            float x = benchmark.min + i * step;
+            float expected = benchmark.reference(x);
+            float error = fabsf(benchmark.fast(x) - expected);
+
+            if (benchmark.is_relative_error) {
+                if (expected == 0.f) continue;
+                error /= fabsf(expected);
+            }
+
+            worst_error = max(worst_error, error);
+        }
+
+        uint32_t fast_cycles, reference_cycles;
+        volatile float sink = time_fast_math_function(benchmark, benchmark.fast, fast_cycles);
+        sink = time_fast_math_function(benchmark, benchmark.reference, reference_cycles);
+        (void)sink;
+
+        bool is_within_bound = worst_error <= benchmark.max_error;
+        if (!is_within_bound) {
+            failed_count++;
+        }
+
+        // Errors are logged in billionths, since they're too small for FLT_FMT3
+        patch.PrintLine(
+            "fast %s: " FLT_FMT3 " ns/call vs libm " FLT_FMT3 " ns/call, max %s error %de-9 (bound %de-9), %s",
+            benchmark.name,
+            FLT_VAR3(fast_cycles * ns_per_cycle / FAST_MATH_BENCHMARK_SAMPLES),
+            FLT_VAR3(reference_cycles * ns_per_cycle / FAST_MATH_BENCHMARK_SAMPLES),
+            benchmark.is_relative_error ? "relative" : "absolute",
+            (int)ceilf(worst_error * 1000000000),
+            (int)ceilf(benchmark.max_error * 1000000000),
+            is_within_bound ? "ok" : "OUT OF BOUND"
+        );
+    }
+
+    patch.PrintLine("Fast math done, %d functions out of bound", failed_count);
+}
+
+// Records some transients, pauses, then resumes part way round the buffer and
+// checks the index still finds the right ones. Returns false if it doesn't.
+bool run_transient_index_check() {
+    TransientIndex<MAX_TRANSIENTS> index;
+    index.Init(RECORDING_BUFFER_SIZE);
+
+    // Record transients at 1000, 50000 and 100000, then pause
+    for (size_t head = 0; head <= 100000; head++) {
+        index.Evict(head);
+        if (head == 1000 || head == 50000 || head == 100000) {
+            index.Insert(head);
+        }
+    }
+
+    // Resume at 60000, record a transient at 70000 and overwrite the one at 100000
+    index.Reanchor(60000);
+    for (size_t head = 60000; head <= 110000; head++) {
+        index.Evict(head);
+        if (head == 70000) {
+            index.Insert(head);
+        }
+    }
+
+    size_t transient;
+    bool is_ok = index.GetCount() == 3
+            && index.FindAtOrBefore(30000, transient) && transient == 1000
+            && index.FindAtOrBefore(55000, transient) && transient == 50000
+            && index.FindAtOrBefore(80000, transient) && transient == 70000
+            && index.FindAtOrBefore(105000, transient) && transient == 70000
+            && index.FindAtOrBefore(500, transient) && transient == 70000;
+
+    patch.PrintLine("Transient index pause/resume: %s", is_ok ? "ok" : "FAILED");
+
+    return is_ok;
+}
+
+// Feeds the MIDI scheduler notes with known arrival times, including one from
+// before the block started, one out of order and one that arrives too late,
+// and checks each one plays at the right sample. Returns false if any don't.
+bool run_midi_scheduler_check() {
+    const uint32_t start_us = 1000000;
+    const uint32_t block_us = 1000; // 48 samples at 48kHz
+    const size_t note_count = 7;
+    const int32_t arrival_offsets_us[note_count] = {-100, 0, 260, 510, 990, 500, 0};
+    // The block starting at start_us is at sample 48, plus a block of latency.
+    // The out of order note is held back to the one before, the late one plays as soon as it can.
+    const uint32_t expected_samples[note_count] = {92, 96, 108, 120, 143, 143, 144};
+
+    MidiScheduler<8> scheduler;
+    scheduler.Init(48000.f, BENCHMARK_BLOCK_SIZE);
+    scheduler.OnBlockStart(BENCHMARK_BLOCK_SIZE, start_us);
+
+    uint32_t played_samples[note_count] = {};
+    size_t played_count = 0;
+    uint32_t block_start_sample = BENCHMARK_BLOCK_SIZE;
+
+    for (size_t block = 0; block < 3; block++) {
+        if (block > 0) {
+            scheduler.OnBlockStart(BENCHMARK_BLOCK_SIZE, start_us + block * block_us);
+            block_start_sample += BENCHMARK_BLOCK_SIZE;
+        }
+
+        // Everything but the late note arrives during the first block, the late one in the last
+        for (size_t n = 0; n < note_count; n++) {
+            bool is_late_note = n == note_count - 1;
+            if (block == (is_late_note ? 2 : 0)) {
+                scheduler.ScheduleNoteOn(n, 127, start_us + arrival_offsets_us[n]);
+            }
+        }
+
+        ScheduledNote note;
+        for (size_t i = 0; i < BENCHMARK_BLOCK_SIZE; i++) {
+            while (scheduler.PopDue(i, note) && played_count < note_count) {
+                played_samples[note.note] = block_start_sample + i;
+                played_count++;
+            }
+        }
+    }
+
+    bool is_ok = played_count == note_count;
+    for (size_t n = 0; n < note_count; n++) {
+        is_ok = is_ok && played_samples[n] == expected_samples[n];
+    }
+
+    // One slot is always kept free to tell full from empty
+    size_t scheduled_count = 0;
+    while (scheduler.ScheduleNoteOn(0, 127, start_us) && scheduled_count < 8) {
+        scheduled_count++;
+    }
+    is_ok = is_ok && scheduled_count == 7;
+
+    patch.PrintLine("MIDI scheduler timing: %s", is_ok ? "ok" : "FAILED");
+
+    return is_ok;
+}
+
+// Renders a scenario block by block and returns a checksum of the output. cycles
+// covers calculate_audio_out, plus the prefetcher's share of the audio callback
+// when use_prefetch is set. With prefetching, each block's windows are also
+// checked against the recording, counting the windows and any mismatched samples.
+uint32_t render_benchmark_scenario(
+    const BenchmarkScenario &scenario,
+    size_t scenario_index,
+    bool use_prefetch,
+    uint64_t &cycles,
+    size_t &window_count,
+    size_t &mismatch_count
+) {
+    srand(scenario_index + 1);
+    reset_grains();
+    grain_prefetcher.Init();
+    reverb.Init(patch.AudioSampleRate());
+    reverb_wet_mix = scenario.reverb ? 0.7f : 0.f;
+    is_reverb_bypassed = !scenario.reverb;
+
+    // Stagger the starting grains so the grain count stays steady
+    int spawn_count = 0;
+    for (int i = 0; i < scenario.grain_count; i++) {
+        Grain &grain = grains[spawn_benchmark_grain(scenario, spawn_count++)];
+        grain.step = grain.length * i / scenario.grain_count;
+    }
+
+    cycles = 0;
+    window_count = 0;
+    mismatch_count = 0;
+    uint32_t checksum = 2166136261u;
+    float out_l[BENCHMARK_BLOCK_SIZE];
+    float out_r[BENCHMARK_BLOCK_SIZE];
+
+    for (size_t block_start = 0; block_start < BENCHMARK_SAMPLES; block_start += BENCHMARK_BLOCK_SIZE) {
+        uint32_t untimed_cycles = 0; // Taken back off, so spawning and checking aren't timed
+        uint32_t start_cycles = DWT->CYCCNT;
+
+        if (use_prefetch) {
+            grain_prefetcher.OnBlockStart();
+
+            uint32_t check_start_cycles = DWT->CYCCNT;
+            window_count += grain_prefetcher.GetWindowCount();
+            mismatch_count += grain_prefetcher.CountMismatches(recording);
+            untimed_cycles += DWT->CYCCNT - check_start_cycles;
+        }
+
+        for (size_t i = 0; i < BENCHMARK_BLOCK_SIZE; i++) {
+            if (MAX_GRAIN_COUNT - (int)available_grains.GetNumElements() < scenario.grain_count) {
+                uint32_t spawn_start_cycles = DWT->CYCCNT;
+
+                while (MAX_GRAIN_COUNT - (int)available_grains.GetNumElements() < scenario.grain_count) {
+                    spawn_benchmark_grain(scenario, spawn_count++);
+                }
+
+                untimed_cycles += DWT->CYCCNT - spawn_start_cycles;
+            }
+
+            calculate_audio_out(0.f, 0.f, out_l[i], out_r[i]);
+        }
+
+        if (use_prefetch) {
+            prefetch_grain_windows(BENCHMARK_BLOCK_SIZE);
+        }
+
+        cycles += DWT->CYCCNT - start_cycles - untimed_cycles;
+
+        // Stands in for the gap between audio callbacks
+        grain_prefetcher.WaitForTransfer();
+
+        for (size_t i = 0; i < BENCHMARK_BLOCK_SIZE; i++) {
+            checksum = hash_sample(checksum, out_l[i]);
+            checksum = hash_sample(checksum, out_r[i]);
+        }
+    }
+
+    grain_prefetcher.Init();
+
+    return checksum;
+}
+
+// Renders each scenario through calculate_audio_out, with and without grain
+// prefetching, and logs how long it took
+// and whether the output still matches its golden checksum.
+// Clobbers the recording, grains and reverb, so only run this before audio starts.
+void run_benchmarks() {
+    // Count CPU cycles. The M7 needs the DWT unlocking first
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->LAR = 0xC5ACCE55;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    float ns_per_cycle = 1000000000.f / System::GetSysClkFreq();
+    int changed_scenario_count = 0;
+    int missing_golden_count = 0;
+    int prefetch_failure_count = 0;
+    uint32_t checksums[BENCHMARK_SCENARIO_COUNT] = {};
+
+    // Something to play back that isn't silence
+    srand(1);
+    for (size_t i = 0; i < RECORDING_BUFFER_SIZE; i++) {
+        recording[i] = 0.5f * sinf(i * 0.01f) + randF(-0.1f, 0.1f);
+    }
+
+    patch.PrintLine("Benchmarking %d samples per scenario", (int)BENCHMARK_SAMPLES);
+
+    for (size_t s = 0; s < BENCHMARK_SCENARIO_COUNT; s++) {
+        const BenchmarkScenario &scenario = BENCHMARK_SCENARIOS[s];
+
+        if (scenario.grain_count > MAX_GRAIN_COUNT) {
+            patch.PrintLine("%s: skipped, MAX_GRAIN_COUNT is %d", scenario.name, MAX_GRAIN_COUNT);
+            continue;
+        }
+
+        uint64_t cycles, prefetch_cycles;
+        size_t window_count, mismatch_count;
+        uint32_t checksum = render_benchmark_scenario(scenario, s, false, cycles, window_count, mismatch_count);
+        uint32_t prefetch_checksum = render_benchmark_scenario(scenario, s, true, prefetch_cycles, window_count, mismatch_count);
+
+        float ns_per_sample = cycles * ns_per_cycle / BENCHMARK_SAMPLES;
+        float ns_per_grain_sample = ns_per_sample / scenario.grain_count;
+        float prefetch_ns_per_sample = prefetch_cycles * ns_per_cycle / BENCHMARK_SAMPLES;
+        float prefetch_ns_per_grain_sample = prefetch_ns_per_sample / scenario.grain_count;
+        float windows_per_block = window_count / (float)(BENCHMARK_SAMPLES / BENCHMARK_BLOCK_SIZE);
+
+        bool is_prefetch_correct = mismatch_count == 0 && prefetch_checksum == checksum;
+        if (!is_prefetch_correct) {
+            prefetch_failure_count++;
+        }
+
+        checksums[s] = checksum;
+
+        const char *golden_result;
+        if (BENCHMARK_GOLDEN_CHECKSUMS[s] == 0) {
+            golden_result = "no golden";
+            missing_golden_count++;
+        } else if (BENCHMARK_GOLDEN_CHECKSUMS[s] == checksum) {
+            golden_result = "matches golden";
+        } else {
+            golden_result = "CHANGED";
+            changed_scenario_count++;
+        }
+
+        patch.PrintLine(
+            "%s: " FLT_FMT3 " ns/sample, " FLT_FMT3 " ns/grain-sample, checksum 0x%08lx, %s",
+            scenario.name,
+            FLT_VAR3(ns_per_sample),
+            FLT_VAR3(ns_per_grain_sample),
+            (unsigned long)checksum,
+            golden_result
+        );
+        patch.PrintLine(
+            "    with prefetch: " FLT_FMT3 " ns/sample, " FLT_FMT3 " ns/grain-sample, " FLT_FMT3 " windows/block, %d mismatched samples, %s",
+            FLT_VAR3(prefetch_ns_per_sample),
+            FLT_VAR3(prefetch_ns_per_grain_sample),
+            FLT_VAR3(windows_per_block),
+            (int)mismatch_count,
+            is_prefetch_correct ? "output matches" : "OUTPUT DIFFERS"
+        );
+    }
+
+    patch.PrintLine(
+        "Benchmarks done, %d scenarios changed output, %d have no golden, %d wrong with prefetch",
+        changed_scenario_count,
+        missing_golden_count,
+        prefetch_failure_count
+    );
+
+    // Ready to paste over BENCHMARK_GOLDEN_CHECKSUMS
+    if (changed_scenario_count > 0 || missing_golden_count > 0) {
+        patch.PrintLine("const uint32_t BENCHMARK_GOLDEN_CHECKSUMS[BENCHMARK_SCENARIO_COUNT] = {");
+        for (size_t s = 0; s < BENCHMARK_SCENARIO_COUNT; s++) {
+            patch.PrintLine("    0x%08lx, // %s", (unsigned long)checksums[s], BENCHMARK_SCENARIOS[s].name);
+        }
+        patch.PrintLine("};");
+    }
+
+    run_fast_math_benchmarks(ns_per_cycle);
+    run_transient_index_check();
+    run_midi_scheduler_check();
+
+    // Put everything back the way init left it
+    memset(recording, 0, sizeof(recording));
+    reset_grains();
+    reverb.Init(patch.AudioSampleRate());
+    reverb_wet_mix = 0.f;
+    is_reverb_bypassed = false;
+}
+
 void init() {
     patch.Init();
-    patch.StartLog();
+    patch.StartLog(RUN_BENCHMARKS); // Wait for a serial monitor so the results aren't lost
 
     // Init GPIO
     density_length_link_switch.Init(patch.D5, 0, Switch::TYPE_TOGGLE, Switch::POLARITY_NORMAL, Switch::PULL_NONE);
@@ -545,14 +1200,80 @@ void init() {
     memset(renderable_recording, 0, sizeof(renderable_recording));
     memset(recording, 0, sizeof(recording));
 
+    onset_detector.Init(patch.AudioSampleRate());
+    transient_index.Init(RECORDING_BUFFER_SIZE);
+
+    // Init MIDI
+    midi_scheduler.Init(patch.AudioSampleRate(), patch.AudioBlockSize());
+    MidiUartTransport::Config midi_config;
+    midi.Init(midi_config, &midi_scheduler);
+    mock_midi.Init(MOCK_MIDI_INTERVAL_MILLIS);
+
+    // The scheduler only takes one producer, so the mock replaces the UART
+    if (!USE_MOCK_MIDI) {
+        midi.StartReceive();
+    }
+
+    if (!grain_prefetcher.Init()) {
+        patch.PrintLine("Grain prefetch disabled, the windows aren't in AXI SRAM");
+    }
+
     cpu_load_meter.Init(patch.AudioSampleRate(), patch.AudioBlockSize());
+    deadline_watchdog.Init(patch.AudioSampleRate(), patch.AudioBlockSize(), (int)Degradation::COUNT - 1);
     reverb.Init(patch.AudioSampleRate());
+
+    if (RUN_BENCHMARKS) { run_benchmarks(); }
+
     patch.StartAudio(AudioCallback);
 }
 
+// Real notes are scheduled from the UART interrupt, this just keeps it running
+void poll_midi() {
+    if (USE_MOCK_MIDI) {
+        uint8_t note, velocity;
+        while (mock_midi.Poll(note, velocity)) {
+            midi_scheduler.ScheduleNoteOn(note, velocity, System::GetUs());
+        }
+        return;
+    }
+
+    midi.Listen();
+}
+
+// Logs the audio deadline stats whenever there's been an overrun or the degradation level changed
+void log_deadline_info() {
+    uint32_t overrun_count = deadline_watchdog.GetOverrunCount();
+    int degradation_level = deadline_watchdog.GetLevel();
+
+    if (overrun_count == last_logged_overrun_count && degradation_level == last_logged_degradation_level) return;
+
+    last_logged_overrun_count = overrun_count;
+    last_logged_degradation_level = degradation_level;
+
+    patch.PrintLine("Audio overruns: %lu, degradation level: %d", (unsigned long)overrun_count, degradation_level);
+
+    patch.Print("Block load histogram (10%% buckets):");
+    for (size_t bucket = 0; bucket < LOAD_HISTOGRAM_BUCKET_COUNT; bucket++) {
+        patch.Print(" %lu", (unsigned long)deadline_watchdog.GetHistogramCount(bucket));
+    }
+    patch.PrintLine("");
+}
+
+// Logs whenever more grain prefetches missed their block and fell back to reading SDRAM
+void log_prefetch_info() {
+    uint32_t failed_count = grain_prefetcher.GetFailedTransferCount();
+    if (failed_count == last_logged_failed_prefetch_count) return;
+
+    last_logged_failed_prefetch_count = failed_count;
+    patch.PrintLine("Failed grain prefetches: %lu", (unsigned long)failed_count);
+}
+
 void log_debug_info() {
     last_debug_print_millis = System::GetNow();
 
+    log_deadline_info();
+    log_prefetch_info();
+
     // Note, this ignores any work done in this loop, eg running the OLED
     // patch.PrintLine("cpu Max: " FLT_FMT3 " Avg:" FLT_FMT3, FLT_VAR3(cpu_load_meter.GetMaxCpuLoad()), FLT_VAR3(cpu_load_meter.GetAvgCpuLoad()));
     // patch.PrintLine(FLT_FMT3, FLT_VAR3(renderable_recording[(int)(write_head * RECORDING_TO_RENDERABLE_RECORDING_BUFFER_RATIO)]));
@@ -588,7 +1309,12 @@ void AudioCallback(
     AudioHandle::OutputBuffer out,
     size_t size
 ) {
+    // First, so the time spent on everything else doesn't jitter MIDI timestamps
+    midi_scheduler.OnBlockStart(size, System::GetUs());
+
     cpu_load_meter.OnBlockStart();
+    deadline_watchdog.OnBlockStart();
+    grain_prefetcher.OnBlockStart();
 
     process_controls();
 
@@ -598,6 +1324,7 @@ void AudioCallback(
         if (is_recording) {
             record_sample(IN_L[i]);
             record_sample_for_display(IN_L[i]);
+            record_transients(IN_L[i]);
         }
 
         // Progresses the write head regardless of if we're recording
@@ -606,29 +1333,54 @@ void AudioCallback(
         // Work out if we need to spawn a grain this sample
         samples_since_last_non_manual_spawn++;
 
-        bool has_spawn_timer_elapsed = actual_spawn_time != INFINITY 
-                && samples_since_last_non_manual_spawn >= actual_spawn_time;
+        bool has_spawn_timer_elapsed;
+        if (spawn_mode == SpawnMode::STRETCH) {
+            has_spawn_timer_elapsed = samples_since_last_non_manual_spawn >= (uint32_t)stretch_hop;
+        } else {
+            has_spawn_timer_elapsed = actual_spawn_time != INFINITY 
+                    && samples_since_last_non_manual_spawn >= actual_spawn_time;
+        }
         bool should_manual_spawn = (spawn_gate.RisingEdge() || spawn_button.RisingEdge()) && primed_for_manual_spawn;
 
+        bool is_stretch_spawn = spawn_mode == SpawnMode::STRETCH && has_spawn_timer_elapsed;
+        // A hop grain can't stand in for a manual spawn, so they each get their own
+        bool should_spawn_separately = is_stretch_spawn && should_manual_spawn;
+
         // Spawn grains
-        if ((has_spawn_timer_elapsed || should_manual_spawn) && !available_grains.IsEmpty()) {
-            spawn_grain();
+        if ((has_spawn_timer_elapsed || should_manual_spawn) && can_spawn_grain(is_stretch_spawn)) {
+            spawn_grain(pitch_shift_in_octaves, 1.f, is_stretch_spawn);
 
             if (has_spawn_timer_elapsed) {
                 samples_since_last_non_manual_spawn = 0;
             }
 
-            if (should_manual_spawn) {
+            if (should_manual_spawn && !should_spawn_separately) {
                 primed_for_manual_spawn = false;
             }
         }
 
+        if (should_spawn_separately && can_spawn_grain(false)) {
+            spawn_grain(pitch_shift_in_octaves, 1.f, false);
+            primed_for_manual_spawn = false;
+        }
+
+        // MIDI notes spawn on top of the regular grains
+        ScheduledNote note;
+        while (midi_scheduler.PopDue(i, note)) {
+            if (can_spawn_grain(false)) {
+                spawn_midi_grain(note);
+            }
+        }
+
         calculate_audio_out(IN_L[i], IN_L[i], OUT_L[i], OUT_R[i]);
 
         spawn_position_offset += spawn_position_scan_speed;
         spawn_position_offset = fwrap(spawn_position_offset, 0, RECORDING_BUFFER_SIZE);
     }
 
+    prefetch_grain_windows(size);
+
+    deadline_watchdog.OnBlockEnd();
     cpu_load_meter.OnBlockEnd();
 }
 
@@ -638,13 +1390,17 @@ int main(void)
     patch.SetLed(true); // Turn on LED when init is complete
 
     while(1) {
+        poll_midi();
+
         // Draw to oled
-        if (System::GetNow() - last_oled_update_millis > 8 && !oled.isRendering()) {
+        uint32_t oled_update_millis = is_degraded(Degradation::SLOW_DISPLAY) ? DEGRADED_OLED_UPDATE_MILLIS : OLED_UPDATE_MILLIS;
+        if (System::GetNow() - last_oled_update_millis > oled_update_millis && !oled.isRendering()) {
             oled.clear(SSD1327_BLACK);
             // draw_color_circle();
             draw_recorded_waveform();
             draw_write_head_indicator();
             draw_grain_spawn_positions();
+            if (spawn_mode == SpawnMode::SNAP_TO_TRANSIENTS) { draw_transients(); }
             draw_spawn_flashes();
             draw_grains();
             if (SHOW_PERFORMANCE_BARS) { draw_performance_bars(); }
@@ -0,0 +1,128 @@
+#ifndef GRAINWAVES_DEADLINE_WATCHDOG
+#define GRAINWAVES_DEADLINE_WATCHDOG
+
+#include "daisy_patch_sm.h"
+
+using namespace daisy;
+
+const size_t LOAD_HISTOGRAM_BUCKET_COUNT = 12; // 10% each, the last bucket is 110% and over
+const float DEGRADE_LOAD = 0.9f; // Fraction of the block period
+const float RECOVER_LOAD = 0.6f;
+const float DEGRADE_HOLD_SECONDS = 0.05f; // Give each level time to take effect before going further
+const float RECOVER_HOLD_SECONDS = 2.f; // Needs to stay under RECOVER_LOAD this long to step back up
+const int MAX_WATCHDOG_LEVEL = 8;
+
+// Times each audio block against the block period and picks a degradation
+// level. Overruns degrade straight away, sustained high load degrades one
+// level at a time, and only a long stretch of low load recovers. Each step
+// down measures how much load it saved, and only steps back up if adding
+// that back would still leave the block under DEGRADE_LOAD.
+class DeadlineWatchdog
+{
+  public:
+    DeadlineWatchdog() {}
+    ~DeadlineWatchdog() {}
+
+    void Init(float sample_rate, size_t block_size, int max_level) {
+        float blocks_per_second = sample_rate / block_size;
+        ticks_per_block_ = System::GetTickFreq() / blocks_per_second;
+        degrade_hold_blocks_ = DEGRADE_HOLD_SECONDS * blocks_per_second;
+        recover_hold_blocks_ = RECOVER_HOLD_SECONDS * blocks_per_second;
+        max_level_ = max_level < MAX_WATCHDOG_LEVEL ? max_level : MAX_WATCHDOG_LEVEL;
+        level_ = 0;
+        overrun_count_ = 0;
+        blocks_since_level_change_ = 0;
+        low_load_blocks_ = 0;
+        low_load_peak_ = 0.f;
+        is_measuring_saving_ = false;
+        memset(histogram_, 0, sizeof(histogram_));
+        memset(savings_, 0, sizeof(savings_));
+    }
+
+    void OnBlockStart() {
+        block_start_tick_ = System::GetTick();
+    }
+
+    void OnBlockEnd() {
+        float load = (System::GetTick() - block_start_tick_) / ticks_per_block_;
+
+        size_t bucket = load * 10;
+        histogram_[bucket < LOAD_HISTOGRAM_BUCKET_COUNT ? bucket : LOAD_HISTOGRAM_BUCKET_COUNT - 1]++;
+
+        blocks_since_level_change_++;
+
+        // Average the load over the hold after stepping down to see what the step saved
+        if (is_measuring_saving_) {
+            load_since_level_change_ += load;
+            savings_[level_] = load_before_level_change_ - load_since_level_change_ / blocks_since_level_change_;
+            is_measuring_saving_ = blocks_since_level_change_ < degrade_hold_blocks_;
+        }
+
+        if (load < RECOVER_LOAD) {
+            low_load_blocks_++;
+            low_load_peak_ = load > low_load_peak_ ? load : low_load_peak_;
+        } else {
+            low_load_blocks_ = 0;
+            low_load_peak_ = 0.f;
+        }
+
+        if (load > 1.f) {
+            overrun_count_++;
+            ChangeLevel(1, load);
+        } else if (load > DEGRADE_LOAD && blocks_since_level_change_ >= degrade_hold_blocks_) {
+            ChangeLevel(1, load);
+        } else if (low_load_blocks_ >= recover_hold_blocks_) {
+            if (low_load_peak_ + savings_[level_] < DEGRADE_LOAD) {
+                ChangeLevel(-1, load);
+            } else {
+                // Putting the feature back would overload it, so start watching a fresh stretch
+                low_load_blocks_ = 0;
+                low_load_peak_ = 0.f;
+            }
+        }
+    }
+
+    // 0 is fully working, max_level is as degraded as it gets
+    inline int GetLevel() const { return level_; }
+    inline int GetMaxLevel() const { return max_level_; }
+    inline uint32_t GetOverrunCount() const { return overrun_count_; }
+    // Number of blocks with a load between bucket * 10% and (bucket + 1) * 10%
+    inline uint32_t GetHistogramCount(size_t bucket) const { return histogram_[bucket]; }
+
+  private:
+    void ChangeLevel(int direction, float load) {
+        int new_level = level_ + direction;
+        if (new_level < 0 || new_level > max_level_) return;
+
+        level_ = new_level;
+        blocks_since_level_change_ = 0;
+        low_load_blocks_ = 0;
+        low_load_peak_ = 0.f;
+
+        // Until it's measured, assume the step saved everything, so it can't recover early
+        is_measuring_saving_ = direction > 0;
+        if (is_measuring_saving_) {
+            load_before_level_change_ = load;
+            load_since_level_change_ = 0.f;
+            savings_[level_] = load;
+        }
+    }
+
+    float ticks_per_block_;
+    uint32_t degrade_hold_blocks_;
+    uint32_t recover_hold_blocks_;
+    uint32_t block_start_tick_;
+    volatile int level_;
+    int max_level_;
+    volatile uint32_t overrun_count_;
+    uint32_t blocks_since_level_change_;
+    uint32_t low_load_blocks_;
+    float low_load_peak_; // Highest load since low_load_blocks_ started counting
+    float savings_[MAX_WATCHDOG_LEVEL + 1]; // Load saved by stepping down to each level
+    float load_before_level_change_;
+    float load_since_level_change_;
+    bool is_measuring_saving_;
+    uint32_t histogram_[LOAD_HISTOGRAM_BUCKET_COUNT];
+};
+
+#endif
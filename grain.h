@@ -10,6 +10,8 @@ struct Grain {
     float pan = 0; // 0 is left, 1 is right.
     float playback_speed = 0;
     float pitch_shift_in_octaves = 0;
+    float amplitude = 1;
+    bool has_overlap_add_window = false; // Windows of grains overlapping by half sum to 1
 };
 
 inline bool is_alive(Grain grain) {
@@ -0,0 +1,245 @@
+#ifndef GRAINWAVES_GRAIN_PREFETCHER
+#define GRAINWAVES_GRAIN_PREFETCHER
+
+#include "daisy_patch_sm.h"
+
+const size_t CACHE_LINE_SIZE = 32; // Bytes
+const uintptr_t AXI_SRAM_START = 0x24000000; // The MDMA transfers assume the windows and nodes are here
+const uintptr_t AXI_SRAM_END = 0x24080000;
+
+// Copies the span of the recording each grain will read next block out of
+// SDRAM into on-chip SRAM, so the mix only reads fast memory.
+// Plan and start the copies at the end of a block, then call OnBlockStart at
+// the start of the next one before any lookups. On the Daisy the copies are
+// done by the MDMA in the gap between blocks, anywhere else with memcpy.
+// If a copy hasn't finished in time, lookups miss for that block and it counts
+// as a failed transfer.
+template <size_t slot_count, size_t window_size>
+class GrainPrefetcher
+{
+  public:
+    GrainPrefetcher() {}
+    ~GrainPrefetcher() {}
+
+    // Returns false, and never prefetches, if the windows aren't somewhere the MDMA can write
+    bool Init() {
+        transfer_count_ = 0;
+        failed_transfer_count_ = 0;
+        is_transferring_ = false;
+        is_available_ = true;
+
+        for (size_t slot = 0; slot < slot_count; slot++) {
+            starts_[slot] = 0;
+            lengths_[slot] = 0;
+        }
+
+#if defined(STM32H750xx)
+        RCC->AHB3ENR |= RCC_AHB3ENR_MDMAEN;
+        (void)RCC->AHB3ENR; // Make sure the clock is on before touching the MDMA
+
+        is_available_ = IsInAxiSram(windows_, sizeof(windows_)) && IsInAxiSram(nodes_, sizeof(nodes_));
+#endif
+
+        return is_available_;
+    }
+
+    void OnBlockStart() {
+        bool is_complete = is_transferring_ && IsTransferComplete();
+
+        if (is_transferring_ && !is_complete) {
+            AbortTransfer();
+            failed_transfer_count_++;
+        }
+        is_transferring_ = false;
+
+        for (size_t slot = 0; slot < slot_count; slot++) {
+            lengths_[slot] = 0;
+        }
+
+        if (!is_complete) return;
+
+        for (size_t i = 0; i < transfer_count_; i++) {
+            const Transfer &transfer = transfers_[i];
+
+#if defined(STM32H750xx)
+            // Drop anything the cache remembers from before the MDMA wrote to the window
+            SCB_InvalidateDCache_by_Addr((uint32_t *)windows_[transfer.slot], RoundUpToCacheLine(transfer.length * sizeof(float)));
+#endif
+
+            starts_[transfer.slot] = transfer.start;
+            lengths_[transfer.slot] = transfer.length;
+        }
+    }
+
+    // Returns the prefetched copy of the sample at index, or nullptr if the slot's window doesn't cover it
+    inline const float *Find(size_t slot, size_t index) const {
+        size_t offset = index - starts_[slot];
+        return offset < lengths_[slot] ? &windows_[slot][offset] : nullptr;
+    }
+
+    // Number of slots with a window ready this block
+    size_t GetWindowCount() const {
+        size_t count = 0;
+        for (size_t slot = 0; slot < slot_count; slot++) {
+            if (lengths_[slot] > 0) count++;
+        }
+        return count;
+    }
+
+    // Number of samples in this block's windows that don't match source, for checking the copies
+    size_t CountMismatches(const float *source) const {
+        size_t count = 0;
+        for (size_t slot = 0; slot < slot_count; slot++) {
+            for (size_t i = 0; i < lengths_[slot]; i++) {
+                if (windows_[slot][i] != source[starts_[slot] + i]) count++;
+            }
+        }
+        return count;
+    }
+
+    // Copies that were still going (or had errored) when the next block started
+    inline uint32_t GetFailedTransferCount() const { return failed_transfer_count_; }
+
+    void BeginPlan() {
+        transfer_count_ = 0;
+    }
+
+    // Queues a copy of source[start, start + length) into the slot's window.
+    // Returns false if it doesn't fit.
+    bool Plan(size_t slot, const float *source, size_t start, size_t length) {
+        if (length > window_size || transfer_count_ >= slot_count) return false;
+
+        Transfer &transfer = transfers_[transfer_count_++];
+        transfer.slot = slot;
+        transfer.source = source + start;
+        transfer.start = start;
+        transfer.length = length;
+
+        return true;
+    }
+
+    void StartTransfer() {
+        if (transfer_count_ == 0 || !is_available_) return;
+
+#if defined(STM32H750xx)
+        for (size_t i = 0; i < transfer_count_; i++) {
+            const Transfer &transfer = transfers_[i];
+
+            // The MDMA reads SDRAM directly, so flush any recording still sitting in the cache
+            uintptr_t source_start = (uintptr_t)transfer.source & ~(CACHE_LINE_SIZE - 1);
+            uintptr_t source_end = (uintptr_t)(transfer.source + transfer.length);
+            SCB_CleanDCache_by_Addr((uint32_t *)source_start, RoundUpToCacheLine(source_end - source_start));
+
+            MdmaLinkNode &node = nodes_[i];
+            node.CTCR = MDMA_CTCR_SWRM // Software request
+                    | MDMA_CTCR_TRGM_0 | MDMA_CTCR_TRGM_1 // One request runs the whole linked list
+                    | MDMA_CTCR_SINC_1 | MDMA_CTCR_DINC_1 // Increment both addresses...
+                    | MDMA_CTCR_SINCOS_1 | MDMA_CTCR_DINCOS_1 // ...a word at a time
+                    | MDMA_CTCR_SSIZE_1 | MDMA_CTCR_DSIZE_1 // Word sized reads and writes
+                    | (127 << MDMA_CTCR_TLEN_Pos); // 128 byte buffers
+            node.CBNDTR = transfer.length * sizeof(float);
+            node.CSAR = (uint32_t)transfer.source;
+            node.CDAR = (uint32_t)windows_[transfer.slot];
+            node.CBRUR = 0;
+            node.CLAR = (i + 1 < transfer_count_) ? (uint32_t)&nodes_[i + 1] : 0;
+            node.CTBR = 0; // Both sides on the AXI bus
+            node.CMAR = 0;
+            node.CMDR = 0;
+        }
+
+        // The MDMA reads the linked list from memory too
+        SCB_CleanDCache_by_Addr((uint32_t *)nodes_, RoundUpToCacheLine(transfer_count_ * sizeof(MdmaLinkNode)));
+
+        MDMA_Channel_TypeDef *channel = MDMA_Channel15;
+        channel->CCR &= ~MDMA_CCR_EN;
+        channel->CIFCR = MDMA_CIFCR_CTEIF | MDMA_CIFCR_CCTCIF | MDMA_CIFCR_CBRTIF | MDMA_CIFCR_CBTIF | MDMA_CIFCR_CLTCIF;
+
+        // The first node goes straight into the channel, the rest get loaded as it goes
+        channel->CTCR = nodes_[0].CTCR;
+        channel->CBNDTR = nodes_[0].CBNDTR;
+        channel->CSAR = nodes_[0].CSAR;
+        channel->CDAR = nodes_[0].CDAR;
+        channel->CBRUR = nodes_[0].CBRUR;
+        channel->CLAR = nodes_[0].CLAR;
+        channel->CTBR = nodes_[0].CTBR;
+        channel->CMAR = nodes_[0].CMAR;
+        channel->CMDR = nodes_[0].CMDR;
+
+        channel->CCR = MDMA_CCR_EN;
+        channel->CCR |= MDMA_CCR_SWRQ;
+#else
+        for (size_t i = 0; i < transfer_count_; i++) {
+            const Transfer &transfer = transfers_[i];
+            memcpy(windows_[transfer.slot], transfer.source, transfer.length * sizeof(float));
+        }
+#endif
+
+        is_transferring_ = true;
+    }
+
+    // Blocks until the current copy finishes or errors
+    void WaitForTransfer() const {
+#if defined(STM32H750xx)
+        if (!is_transferring_) return;
+        while (!(MDMA_Channel15->CISR & (MDMA_CISR_CTCIF | MDMA_CISR_TEIF))) {}
+#endif
+    }
+
+  private:
+    struct Transfer {
+        const float *source;
+        size_t slot;
+        size_t start;
+        size_t length;
+    };
+
+#if defined(STM32H750xx)
+    // Matches the layout of the MDMA channel registers, see RM0433 "MDMA linked list"
+    struct alignas(8) MdmaLinkNode {
+        uint32_t CTCR, CBNDTR, CSAR, CDAR, CBRUR, CLAR, CTBR, reserved, CMAR, CMDR;
+    };
+#endif
+
+    inline size_t RoundUpToCacheLine(size_t bytes) const {
+        return (bytes + CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1);
+    }
+
+    bool IsTransferComplete() const {
+#if defined(STM32H750xx)
+        uint32_t status = MDMA_Channel15->CISR;
+        return (status & MDMA_CISR_CTCIF) && !(status & MDMA_CISR_TEIF);
+#else
+        return true;
+#endif
+    }
+
+#if defined(STM32H750xx)
+    bool IsInAxiSram(const void *start, size_t bytes) const {
+        uintptr_t address = (uintptr_t)start;
+        return address >= AXI_SRAM_START && address + bytes <= AXI_SRAM_END;
+    }
+#endif
+
+    void AbortTransfer() {
+#if defined(STM32H750xx)
+        MDMA_Channel15->CCR &= ~MDMA_CCR_EN;
+        while (MDMA_Channel15->CISR & MDMA_CISR_CRQA) {}
+#endif
+    }
+
+    alignas(CACHE_LINE_SIZE) float windows_[slot_count][window_size];
+    size_t starts_[slot_count];
+    size_t lengths_[slot_count];
+    Transfer transfers_[slot_count];
+    size_t transfer_count_;
+    volatile uint32_t failed_transfer_count_;
+    bool is_transferring_;
+    bool is_available_;
+#if defined(STM32H750xx)
+    alignas(CACHE_LINE_SIZE) MdmaLinkNode nodes_[slot_count];
+#endif
+
+    static_assert((window_size * sizeof(float)) % CACHE_LINE_SIZE == 0, "Windows must fill whole cache lines");
+};
+
+#endif
@@ -0,0 +1,211 @@
+#ifndef GRAINWAVES_MIDI_SCHEDULER
+#define GRAINWAVES_MIDI_SCHEDULER
+
+#include <atomic>
+#include "daisy_patch_sm.h"
+
+using namespace daisy;
+
+struct ScheduledNote {
+    uint32_t sample_time = 0; // On the audio callback's sample clock
+    uint8_t note = 0;
+    uint8_t velocity = 0;
+};
+
+// Takes note ons stamped with when they arrived and hands them to the audio
+// callback at the matching sample, one block later. The fixed latency means
+// notes keep their relative timing instead of bunching up on block boundaries.
+// Single producer (the MIDI receive interrupt, or the main loop), single
+// consumer (audio callback).
+template <size_t capacity>
+class MidiScheduler
+{
+  public:
+    MidiScheduler() {}
+    ~MidiScheduler() {}
+
+    void Init(float sample_rate, size_t block_size) {
+        samples_per_us_ = sample_rate / 1000000.f;
+        latency_samples_ = block_size;
+        for (size_t i = 0; i < 2; i++) {
+            block_starts_[i].sample = 0;
+            block_starts_[i].us = System::GetUs();
+        }
+        block_start_generation_.store(0);
+        last_scheduled_sample_ = 0;
+        read_.store(0);
+        write_.store(0);
+    }
+
+    // Call from the audio callback, with System::GetUs(), before popping any notes
+    void OnBlockStart(size_t block_size, uint32_t now_us) {
+        uint32_t generation = block_start_generation_.load(std::memory_order_relaxed);
+        const BlockStart &current = block_starts_[generation % 2];
+
+        // Fill in the copy readers aren't using, then switch them over to it
+        BlockStart &next = block_starts_[(generation + 1) % 2];
+        next.sample = current.sample + block_size;
+        next.us = now_us;
+        block_start_generation_.store(generation + 1, std::memory_order_release);
+    }
+
+    // arrival_us is System::GetUs() from when the note's bytes arrived.
+    // Returns false if the queue is full.
+    bool ScheduleNoteOn(uint8_t note, uint8_t velocity, uint32_t arrival_us) {
+        size_t write = write_.load(std::memory_order_relaxed);
+        size_t next_write = (write + 1) % capacity;
+        if (next_write == read_.load(std::memory_order_acquire)) return false;
+
+        uint32_t sample_time = SampleAt(arrival_us) + latency_samples_;
+
+        // Keep the queue in order even if the clock estimate jitters backwards
+        if ((int32_t)(sample_time - last_scheduled_sample_) < 0) {
+            sample_time = last_scheduled_sample_;
+        }
+        last_scheduled_sample_ = sample_time;
+
+        notes_[write].sample_time = sample_time;
+        notes_[write].note = note;
+        notes_[write].velocity = velocity;
+
+        // Release so the note is written before the audio callback can see it
+        write_.store(next_write, std::memory_order_release);
+
+        return true;
+    }
+
+    // Call from the audio callback for each sample in the block.
+    // Returns true and fills in note if one is due at or before this sample.
+    bool PopDue(size_t sample_in_block, ScheduledNote &note) {
+        size_t read = read_.load(std::memory_order_relaxed);
+        if (read == write_.load(std::memory_order_acquire)) return false;
+
+        uint32_t generation = block_start_generation_.load(std::memory_order_relaxed);
+        uint32_t now = block_starts_[generation % 2].sample + sample_in_block;
+        if ((int32_t)(notes_[read].sample_time - now) > 0) return false;
+
+        note = notes_[read];
+
+        // Release so the note is read before the main loop can overwrite it
+        read_.store((read + 1) % capacity, std::memory_order_release);
+
+        return true;
+    }
+
+  private:
+    struct BlockStart {
+        uint32_t sample, us;
+    };
+
+    // Works out where the audio callback's sample clock was at time us
+    uint32_t SampleAt(uint32_t us) const {
+        uint32_t generation, block_start_sample, block_start_us;
+
+        // If the audio callback starts a block under us, retry with the new one.
+        // It only ever writes the other copy, so this can't tear if we interrupted it.
+        do {
+            generation = block_start_generation_.load(std::memory_order_acquire);
+            block_start_sample = block_starts_[generation % 2].sample;
+            block_start_us = block_starts_[generation % 2].us;
+        } while (generation != block_start_generation_.load(std::memory_order_acquire));
+
+        // Signed, as the note may have arrived just before the current block started
+        return block_start_sample + (int32_t)((int32_t)(us - block_start_us) * samples_per_us_);
+    }
+
+    ScheduledNote notes_[capacity];
+    std::atomic<size_t> read_, write_;
+    BlockStart block_starts_[2];
+    std::atomic<uint32_t> block_start_generation_;
+    uint32_t last_scheduled_sample_;
+    uint32_t latency_samples_;
+    float samples_per_us_;
+};
+
+// Receives MIDI over the UART and schedules note ons from the receive
+// interrupt, stamped with when their bytes arrived, so how busy the main loop
+// is doesn't affect note timing.
+template <size_t capacity>
+class MidiUartReceiver
+{
+  public:
+    MidiUartReceiver() {}
+    ~MidiUartReceiver() {}
+
+    void Init(MidiUartTransport::Config config, MidiScheduler<capacity> *scheduler) {
+        scheduler_ = scheduler;
+        transport_.Init(config);
+        parser_.Init();
+    }
+
+    void StartReceive() {
+        transport_.StartRx(OnReceive, this);
+    }
+
+    // Call from the main loop. The UART stops itself on errors (eg. overruns), so this restarts it.
+    void Listen() {
+        if (!transport_.RxActive()) {
+            parser_.Reset();
+            transport_.FlushRx();
+            StartReceive();
+        }
+    }
+
+  private:
+    // Runs in the UART's interrupt
+    static void OnReceive(uint8_t *data, size_t size, void *context) {
+        MidiUartReceiver *receiver = (MidiUartReceiver *)context;
+        uint32_t arrival_us = System::GetUs();
+
+        for (size_t i = 0; i < size; i++) {
+            MidiEvent event;
+            if (!receiver->parser_.Parse(data[i], &event) || event.type != NoteOn) continue;
+
+            // Grains play out their full length, so note offs (including zero velocity note ons) are ignored
+            NoteOnEvent note_on = event.AsNoteOn();
+            if (note_on.velocity > 0) {
+                receiver->scheduler_->ScheduleNoteOn(note_on.note, note_on.velocity, arrival_us);
+            }
+        }
+    }
+
+    MidiUartTransport transport_;
+    MidiParser parser_;
+    MidiScheduler<capacity> *scheduler_;
+};
+
+// Plays a looping arpeggio, for trying out the MIDI path without a MIDI source
+class MockMidiStream
+{
+  public:
+    MockMidiStream() {}
+    ~MockMidiStream() {}
+
+    void Init(uint32_t interval_millis) {
+        interval_millis_ = interval_millis;
+        last_note_millis_ = System::GetNow();
+        step_ = 0;
+    }
+
+    // Returns true and fills in note and velocity when the next note is due
+    bool Poll(uint8_t &note, uint8_t &velocity) {
+        static const uint8_t arpeggio[] = {48, 55, 60, 63, 67, 72, 67, 63};
+        const size_t arpeggio_length = sizeof(arpeggio) / sizeof(arpeggio[0]);
+
+        if (System::GetNow() - last_note_millis_ < interval_millis_) return false;
+
+        last_note_millis_ += interval_millis_;
+        note = arpeggio[step_];
+        velocity = (step_ % 2 == 0) ? 127 : 80;
+        step_ = (step_ + 1) % arpeggio_length;
+
+        return true;
+    }
+
+  private:
+    uint32_t interval_millis_;
+    uint32_t last_note_millis_;
+    size_t step_;
+};
+
+#endif
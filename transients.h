@@ -0,0 +1,173 @@
+#ifndef GRAINWAVES_TRANSIENTS
+#define GRAINWAVES_TRANSIENTS
+
+#include "daisysp.h"
+
+const float ONSET_FAST_ENVELOPE_SECONDS = 0.001f;
+const float ONSET_SLOW_ENVELOPE_SECONDS = 0.1f;
+const float ONSET_HOLDOFF_SECONDS = 0.05f;
+const float ONSET_RATIO = 2.f; // How far the fast envelope must jump above the slow one
+const float ONSET_FLOOR = 0.01f; // Ignore anything quieter than this
+
+// Flags the sample where the short term level jumps well above the long term level
+class OnsetDetector
+{
+  public:
+    OnsetDetector() {}
+    ~OnsetDetector() {}
+
+    void Init(float sample_rate) {
+        fast_coeff_ = 1.f - expf(-1.f / (ONSET_FAST_ENVELOPE_SECONDS * sample_rate));
+        slow_coeff_ = 1.f - expf(-1.f / (ONSET_SLOW_ENVELOPE_SECONDS * sample_rate));
+        holdoff_samples_ = ONSET_HOLDOFF_SECONDS * sample_rate;
+        samples_since_onset_ = holdoff_samples_;
+        fast_envelope_ = 0.f;
+        slow_envelope_ = 0.f;
+    }
+
+    // Returns true if this sample is an onset
+    bool Process(float sample) {
+        float magnitude = fabsf(sample);
+        fast_envelope_ += fast_coeff_ * (magnitude - fast_envelope_);
+        slow_envelope_ += slow_coeff_ * (magnitude - slow_envelope_);
+
+        if (samples_since_onset_ < holdoff_samples_) {
+            samples_since_onset_++;
+            return false;
+        }
+
+        if (fast_envelope_ > ONSET_FLOOR && fast_envelope_ > slow_envelope_ * ONSET_RATIO) {
+            samples_since_onset_ = 0;
+            return true;
+        }
+
+        return false;
+    }
+
+  private:
+    float fast_coeff_, slow_coeff_;
+    float fast_envelope_, slow_envelope_;
+    uint32_t holdoff_samples_, samples_since_onset_;
+};
+
+// Positions of transients in a circular recording buffer.
+// Positions are inserted in write order, so measured forwards from the oldest
+// entry they're always sorted, which lets lookups binary search.
+// If the write head jumps without evicting (eg. recording pauses then resumes),
+// call Reanchor so the ordering starts from the write head again.
+template <size_t capacity>
+class TransientIndex
+{
+  public:
+    TransientIndex() {}
+    ~TransientIndex() {}
+
+    void Init(size_t buffer_size) {
+        buffer_size_ = buffer_size;
+        Clear();
+    }
+
+    void Clear() {
+        oldest_ = 0;
+        count_ = 0;
+    }
+
+    // Must be called with positions in write order. Drops the oldest entry when full.
+    void Insert(size_t position) {
+        if (count_ == capacity) {
+            oldest_ = (oldest_ + 1) % capacity;
+            count_--;
+        }
+
+        positions_[(oldest_ + count_) % capacity] = position;
+        count_++;
+    }
+
+    // Drops the transient the write head is about to overwrite. Since the index
+    // starts at the write head (see Reanchor), that can only be the oldest.
+    void Evict(size_t write_head) {
+        if (count_ && Get(0) == write_head) {
+            oldest_ = (oldest_ + 1) % capacity;
+            count_--;
+        }
+    }
+
+    // Rotates the index so it starts at the first transient at or after the write head
+    void Reanchor(size_t write_head) {
+        size_t count = count_;
+        if (count == 0) return;
+
+        size_t first = FindFirstAtOrAfter(write_head);
+        if (first == count) return; // Already starts there
+
+        size_t rotated[capacity];
+        for (size_t i = 0; i < count; i++) {
+            rotated[i] = Get((first + i) % count);
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            positions_[i] = rotated[i];
+        }
+        oldest_ = 0;
+    }
+
+    // Finds the closest transient at or before position, wrapping around the buffer.
+    // Returns false if there are no transients.
+    bool FindAtOrBefore(size_t position, size_t &transient) const {
+        size_t count = count_;
+        if (count == 0) return false;
+
+        // The oldest transient is always at or before the target, so the first
+        // one past it is never index 0
+        size_t first_past = FindFirstPast(position, count);
+
+        transient = Get(first_past - 1);
+        return true;
+    }
+
+    // 0 is the oldest transient
+    inline size_t Get(size_t index) const { return positions_[(oldest_ + index) % capacity]; }
+    inline size_t GetCount() const { return count_; }
+
+  private:
+    // Returns the index of the first transient measured further from the oldest than position, or count
+    size_t FindFirstPast(size_t position, size_t count) const {
+        size_t origin = Get(0);
+        size_t target_distance = DistanceFrom(origin, position);
+
+        size_t low = 0;
+        size_t high = count;
+        while (low < high) {
+            size_t mid = (low + high) / 2;
+
+            if (DistanceFrom(origin, Get(mid)) <= target_distance) {
+                low = mid + 1;
+            } else {
+                high = mid;
+            }
+        }
+
+        return low;
+    }
+
+    // Returns the index of the first transient at or after position (measured from the oldest), or count
+    size_t FindFirstAtOrAfter(size_t position) const {
+        size_t first_past = FindFirstPast(position, count_);
+
+        if (first_past > 0 && Get(first_past - 1) == position) {
+            return first_past - 1;
+        }
+
+        return first_past;
+    }
+
+    inline size_t DistanceFrom(size_t origin, size_t position) const {
+        return position >= origin ? position - origin : position + buffer_size_ - origin;
+    }
+
+    size_t positions_[capacity];
+    size_t buffer_size_;
+    size_t oldest_, count_;
+};
+
+#endif
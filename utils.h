@@ -1,6 +1,7 @@
 #ifndef GRAINWAVES_UTILS
 #define GRAINWAVES_UTILS
 
+#include <cstring>
 #include "daisysp.h"
 
 using namespace daisysp;
@@ -49,6 +50,82 @@ inline float modf(float x) {
     return modf(x, &junk);
 }
 
+// Fast approximations of libm functions for the audio and drawing paths.
+// Each one's maximum error was measured against libm over the range noted
+// next to it. Set RUN_BENCHMARKS to check them on the module.
+const float FAST_EXP2_MAX_RELATIVE_ERROR = 3e-7f; // x in [-126, 127]
+const float FAST_LOG2_MAX_ERROR = 3e-6f; // x in [0.001, 1000]
+const float FAST_LOG10_MAX_ERROR = 1.5e-6f; // x in [0.001, 1000]
+const float FAST_SIN_COS_MAX_ERROR = 2e-5f; // x in [-100, 100], grows with |x| beyond that
+const float FAST_POW_MAX_RELATIVE_ERROR = 1e-5f; // x in (0, 4], y in [-8, 8]
+const float FAST_FMAP_LOG_MAX_RELATIVE_ERROR = 3e-6f; // in in [0, 1], max / min up to 1000
+
+inline float fast_exp2(float x) {
+    x = coerce_in_range(x, -126.f, 127.f);
+
+    // 2^x = 2^whole * 2^fraction, the first is exact and the second is a polynomial
+    float whole = floorf(x);
+    float fraction = x - whole;
+    float mantissa = 0.99999990f + fraction * (0.69315449f + fraction * (0.24014182f + fraction * (0.05586034f + fraction * (0.00894959f + fraction * 0.00189375f))));
+
+    int32_t exponent_bits = ((int32_t)whole + 127) << 23;
+    float exponent;
+    memcpy(&exponent, &exponent_bits, sizeof(exponent));
+
+    return mantissa * exponent;
+}
+
+// x must be positive
+inline float fast_log2(float x) {
+    int32_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+
+    // log2(x) = exponent + log2(mantissa), with the mantissa in [1, 2)
+    float exponent = ((bits >> 23) & 0xFF) - 127;
+    bits = (bits & 0x007FFFFF) | 0x3F800000;
+    float mantissa;
+    memcpy(&mantissa, &bits, sizeof(mantissa));
+
+    float t = mantissa - 1.f;
+    return exponent + t * (1.44269298f + t * (-0.72114409f + t * (0.47749636f + t * (-0.33837720f + t * (0.21394321f + t * (-0.09462681f + t * 0.02001665f))))));
+}
+
+// x must be positive
+inline float fast_log10(float x) {
+    return fast_log2(x) * 0.30102999566f;
+}
+
+// Returns 0 for x <= 0
+inline float fast_pow(float x, float y) {
+    if (x <= 0) return 0;
+
+    return fast_exp2(y * fast_log2(x));
+}
+
+inline float fast_sin(float x) {
+    // Wrap into [-pi, pi], then fold into [-pi/2, pi/2] where the polynomial is accurate
+    float turns = x * (1.f / (PI_F * 2));
+    x = (turns - roundf(turns)) * (PI_F * 2);
+
+    if (x > PI_F * 0.5f) {
+        x = PI_F - x;
+    } else if (x < -PI_F * 0.5f) {
+        x = -PI_F - x;
+    }
+
+    float x2 = x * x;
+    return x * (0.99999999f + x2 * (-0.16666495f + x2 * (0.00832394f + x2 * -0.00018846f)));
+}
+
+inline float fast_cos(float x) {
+    return fast_sin(x + PI_F * 0.5f);
+}
+
+// Same as fmap(in, minimum, maximum, Mapping::LOG), including clamping the result
+inline float fast_fmap_log(float in, float minimum, float maximum) {
+    return coerce_in_range(minimum * fast_exp2(in * fast_log2(maximum / minimum)), minimum, maximum);
+}
+
 // Adds a deadzone centered around zero.
 // Note: Reduces the range by the deadzone size
 float with_dead_zone(float value, float deadzone_size) {
@@ -65,8 +142,8 @@ float with_dead_zone(float value, float deadzone_size) {
 
 inline iVec2 polarToCartesian(float radius, float degrees) {
     float tau = degrees * DEG_TO_TAU;
-    int x = radius * cosf(tau) + 64;
-    int y = radius * sinf(tau) + 64;
+    int x = radius * fast_cos(tau) + 64;
+    int y = radius * fast_sin(tau) + 64;
 
     return {x, y};
 }